@@ -0,0 +1,202 @@
+#pragma once
+
+// Move-only owners for the libav objects used by remux and transcode, and
+// pools that recycle the frame and encoded packet buffers we control.
+
+extern "C" {
+#include <libavutil/avassert.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 5045) // Spectre mitigation notice on indexed loads
+#endif
+
+struct PacketDeleter {
+    void operator()(AVPacket *packet) const { av_packet_free(&packet); }
+};
+
+struct FrameDeleter {
+    void operator()(AVFrame *frame) const { av_frame_free(&frame); }
+};
+
+struct CodecContextDeleter {
+    void operator()(AVCodecContext *context) const { avcodec_free_context(&context); }
+};
+
+struct InputFormatContextDeleter {
+    void operator()(AVFormatContext *context) const { avformat_close_input(&context); }
+};
+
+struct OutputFormatContextDeleter {
+    void operator()(AVFormatContext *context) const {
+        if (!(context->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&context->pb);
+        avformat_free_context(context);
+    }
+};
+
+struct BufferPoolDeleter {
+    void operator()(AVBufferPool *pool) const { av_buffer_pool_uninit(&pool); }
+};
+
+using PacketHandle = std::unique_ptr<AVPacket, PacketDeleter>;
+using FrameHandle = std::unique_ptr<AVFrame, FrameDeleter>;
+using CodecContextHandle = std::unique_ptr<AVCodecContext, CodecContextDeleter>;
+using InputFormatContextHandle = std::unique_ptr<AVFormatContext, InputFormatContextDeleter>;
+using OutputFormatContextHandle = std::unique_ptr<AVFormatContext, OutputFormatContextDeleter>;
+using BufferPoolHandle = std::unique_ptr<AVBufferPool, BufferPoolDeleter>;
+
+/* Number of times one of the pools below was empty and had to allocate a new
+ * data buffer, and number of buffers handed out. Every get, hit or miss, still
+ * mallocs the AVBufferRef inside libavutil. Allocations made elsewhere in
+ * libavcodec or libavformat (encoder-internal packet copies, interleaving queue
+ * entries, frame references...) are not visible from this program. */
+inline std::atomic<uint64_t> pool_miss_count{0};
+inline std::atomic<uint64_t> pool_get_count{0};
+
+inline AVBufferRef *pool_miss_alloc(size_t const size) {
+    pool_miss_count.fetch_add(1, std::memory_order_relaxed);
+    return av_buffer_alloc(size);
+}
+
+inline AVBufferRef *pool_get(AVBufferPool *pool) {
+    pool_get_count.fetch_add(1, std::memory_order_relaxed);
+    return av_buffer_pool_get(pool);
+}
+
+inline PacketHandle make_packet() {
+    return PacketHandle{av_packet_alloc()};
+}
+
+inline FrameHandle make_frame() {
+    return FrameHandle{av_frame_alloc()};
+}
+
+// Recycles the data buffers of a frame that is re-filled for every encode
+// call. Built from a frame allocated with av_frame_get_buffer(), it remembers
+// how the planes are laid out in its buffers and hands out replacements of the
+// same shape from one AVBufferPool per buffer.
+class FramePool {
+    static constexpr std::size_t nb_data_pointers = AV_NUM_DATA_POINTERS;
+
+public:
+    explicit FramePool(AVFrame const *layout) {
+        av_assert0(!layout->nb_extended_buf);
+
+        for (std::size_t i = 0; i < nb_data_pointers && layout->buf[i]; i++)
+            pools_[i] = BufferPoolHandle{av_buffer_pool_init(layout->buf[i]->size, pool_miss_alloc)};
+
+        for (std::size_t plane = 0; plane < nb_data_pointers && layout->data[plane]; plane++) {
+            for (std::size_t i = 0; i < nb_data_pointers && layout->buf[i]; i++) {
+                AVBufferRef const *buf = layout->buf[i];
+                if (layout->data[plane] >= buf->data && layout->data[plane] < buf->data + buf->size) {
+                    plane_buffer_[plane] = i;
+                    plane_offset_[plane] = layout->data[plane] - buf->data;
+                    break;
+                }
+            }
+            nb_planes_ = plane + 1;
+        }
+    }
+
+    FramePool(FramePool const &) = delete;
+    FramePool &operator=(FramePool const &) = delete;
+    FramePool(FramePool &&) = default;
+    FramePool &operator=(FramePool &&) = default;
+
+    /* Like av_frame_make_writable(), except that the previous contents are not
+     * copied and the replacement buffers come from the pool. Only suitable for
+     * frames that are completely overwritten afterwards. */
+    int make_writable(AVFrame *frame) const {
+        if (av_frame_is_writable(frame))
+            return 0;
+
+        for (std::size_t i = 0; i < nb_data_pointers && pools_[i]; i++) {
+            av_buffer_unref(&frame->buf[i]);
+            frame->buf[i] = pool_get(pools_[i].get());
+            if (!frame->buf[i])
+                return AVERROR(ENOMEM);
+        }
+        for (std::size_t plane = 0; plane < nb_planes_; plane++)
+            frame->data[plane] = frame->buf[plane_buffer_[plane]]->data + plane_offset_[plane];
+        frame->extended_data = frame->data;
+        return 0;
+    }
+
+private:
+    std::array<BufferPoolHandle, nb_data_pointers> pools_{};
+    std::array<std::size_t, nb_data_pointers> plane_buffer_{};
+    std::array<ptrdiff_t, nb_data_pointers> plane_offset_{};
+    std::size_t nb_planes_{};
+};
+
+// Arena for encoded packet payloads: power-of-two size classes, each backed by
+// an AVBufferPool, served to encoders through AVCodecContext.get_encode_buffer.
+// Buffers still referenced by the muxer stay valid after the arena is gone.
+// Its address is handed to the codec, so it can be neither copied nor moved.
+class PacketArena {
+public:
+    PacketArena() = default;
+    PacketArena(PacketArena const &) = delete;
+    PacketArena &operator=(PacketArena const &) = delete;
+
+    /* Route the encode buffers of c through this arena. Encoders without
+     * AV_CODEC_CAP_DR1 ignore get_encode_buffer, so they are left alone.
+     * get_encode_buffer may be called from several encoder threads at once,
+     * so every pool is created here and the callback only reads pools_. */
+    void attach(AVCodecContext *c, AVCodec const *codec) {
+        if (!(codec->capabilities & AV_CODEC_CAP_DR1))
+            return;
+        for (std::size_t size_class = 0; size_class < nb_classes; size_class++) {
+            /* no buffer is allocated until the first get */
+            pools_[size_class] = BufferPoolHandle{av_buffer_pool_init(
+                std::size_t{1} << (size_class + min_class_bits), pool_miss_alloc)};
+        }
+        c->opaque = this;
+        c->get_encode_buffer = get_encode_buffer;
+    }
+
+private:
+    static constexpr std::size_t min_class_bits = 10;
+    static constexpr std::size_t nb_classes = 15; /* 1 KiB up to 16 MiB */
+
+    static int get_encode_buffer(AVCodecContext *c, AVPacket *pkt, int const flags) {
+        auto const *arena = static_cast<PacketArena const *>(c->opaque);
+        std::size_t const size = static_cast<std::size_t>(pkt->size) + AV_INPUT_BUFFER_PADDING_SIZE;
+        std::size_t const size_class = std::max(static_cast<std::size_t>(std::bit_width(size - 1)), min_class_bits)
+                                       - min_class_bits;
+        if (size_class >= nb_classes)
+            return avcodec_default_get_encode_buffer(c, pkt, flags);
+
+        AVBufferPool *pool = arena->pools_[size_class].get();
+        if (!pool)
+            return AVERROR(ENOMEM);
+
+        pkt->buf = pool_get(pool);
+        if (!pkt->buf)
+            return AVERROR(ENOMEM);
+        pkt->data = pkt->buf->data;
+        memset(pkt->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        return 0;
+    }
+
+    std::array<BufferPoolHandle, nb_classes> pools_{};
+};
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
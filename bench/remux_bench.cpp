@@ -0,0 +1,315 @@
+#pragma warning(push, 0)
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+#pragma warning(pop)
+
+#include <algorithm>
+#include <iostream>
+#include <print>
+#include <span>
+
+// the shared headers' inline helpers that the benchmark does not use are dropped on purpose
+#pragma warning(disable : 4514)
+
+#include "av_handles.h"
+#include "stream_mapping.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4365)
+#pragma warning(disable : 4388)
+#pragma warning(disable : 5045)
+
+// Packets/s of the remux packet loop with the previous std::map stream mapping
+// and with the dense StreamMapping table, on the same in-memory packets.
+//
+// Packets are demuxed once up front and muxed into the "null" muxer, so the
+// timings cover mapping, rescaling and muxing but not file I/O. The timestamps
+// each loop hands to the muxer are checked against av_packet_rescale_ts()
+// applied with the packet's own input stream, once with every stream kept and
+// once with video skipped, which shifts the output indices of later streams.
+
+constexpr std::initializer_list<AVMediaType> all_media_types{
+    AVMEDIA_TYPE_AUDIO, AVMEDIA_TYPE_VIDEO, AVMEDIA_TYPE_SUBTITLE
+};
+constexpr std::initializer_list<AVMediaType> skip_video_media_types{
+    AVMEDIA_TYPE_AUDIO, AVMEDIA_TYPE_SUBTITLE
+};
+
+struct PacketTimestamps {
+    int64_t stream_index;
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+
+    bool operator==(PacketTimestamps const &) const = default;
+};
+
+struct RunResult {
+    double seconds;
+    std::vector<PacketTimestamps> timestamps;
+    std::vector<AVRational> output_time_bases;
+};
+
+InputFormatContextHandle load_input(const char *input_filename) {
+    AVFormatContext *context{};
+    if (avformat_open_input(&context, input_filename, nullptr, nullptr) < 0)
+        throw std::runtime_error("Could not open input file");
+    InputFormatContextHandle input_format_context{context};
+
+    if (avformat_find_stream_info(input_format_context.get(), nullptr) < 0)
+        throw std::runtime_error("Failed to retrieve input stream information");
+
+    return input_format_context;
+}
+
+std::vector<PacketHandle> read_packets(AVFormatContext *input_format_context) {
+    std::vector<PacketHandle> packets;
+    for (auto packet{make_packet()}; packet && av_read_frame(input_format_context, packet.get()) >= 0;
+         packet = make_packet())
+        packets.push_back(std::move(packet));
+    return packets;
+}
+
+OutputFormatContextHandle create_null_output() {
+    AVFormatContext *output_format_context{};
+    avformat_alloc_output_context2(&output_format_context, nullptr, "null", nullptr);
+    if (!output_format_context)
+        throw std::runtime_error("Could not create output context");
+    return OutputFormatContextHandle{output_format_context};
+}
+
+std::vector<AVRational> write_header(AVFormatContext *output_format_context) {
+    if (avformat_write_header(output_format_context, nullptr) < 0)
+        throw std::runtime_error("Error occurred when opening output");
+
+    std::vector<AVRational> output_time_bases;
+    for (std::span const output_streams{output_format_context->streams, output_format_context->nb_streams};
+         auto const &output_stream : output_streams)
+        output_time_bases.push_back(output_stream->time_base);
+    return output_time_bases;
+}
+
+PacketTimestamps timestamps_of(AVPacket const *packet) {
+    return {int64_t{packet->stream_index}, packet->pts, packet->dts, packet->duration};
+}
+
+// copy_streams() and the body of remux_packets() verbatim from before the
+// StreamMapping table, including its input time base lookup by output index
+std::map<int, int> legacy_copy_streams(AVFormatContext const *input_format_context,
+                                       AVFormatContext *output_format_context,
+                                       std::initializer_list<AVMediaType> relevant_media_types) {
+    std::map<int, int> stream_mapping;
+    int i{};
+
+    for (std::span const input_streams{input_format_context->streams, input_format_context->nb_streams}; auto const &
+         in_stream : input_streams) {
+        auto const input_codec_parameters{in_stream->codecpar};
+
+        if (std::ranges::find(relevant_media_types, input_codec_parameters->codec_type) == relevant_media_types.end()) {
+            i += 1;
+            continue;
+        }
+
+        stream_mapping[in_stream->index] = in_stream->index - i;
+
+        auto const output_stream{avformat_new_stream(output_format_context, nullptr)};
+        if (!output_stream)
+            throw std::runtime_error("Failed allocating output stream");
+
+        if (avcodec_parameters_copy(output_stream->codecpar, input_codec_parameters) < 0)
+            throw std::runtime_error("Failed to copy codec parameters");
+
+        output_stream->codecpar->codec_tag = 0;
+    }
+
+    return stream_mapping;
+}
+
+RunResult run_legacy(AVFormatContext *input_format_context, std::span<PacketHandle const> const packets,
+                     std::initializer_list<AVMediaType> const relevant_media_types) {
+    auto const output{create_null_output()};
+    auto const output_format_context{output.get()};
+    auto const stream_mapping{legacy_copy_streams(input_format_context, output_format_context, relevant_media_types)};
+    RunResult result{};
+    result.output_time_bases = write_header(output_format_context);
+    result.timestamps.reserve(packets.size());
+
+    auto const packet_handle{make_packet()};
+    auto const packet{packet_handle.get()};
+    std::span const input_streams{input_format_context->streams, input_format_context->nb_streams};
+    std::span const output_streams{output_format_context->streams, output_format_context->nb_streams};
+
+    auto const start{std::chrono::steady_clock::now()};
+    for (auto const &source : packets) {
+        if (av_packet_ref(packet, source.get()) < 0)
+            throw std::runtime_error("Could not reference packet");
+
+        if (packet->stream_index >= stream_mapping.size() ||
+            !stream_mapping.contains(packet->stream_index)) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        packet->stream_index = stream_mapping.at(packet->stream_index);
+
+        auto const input_stream{input_streams[packet->stream_index]};
+        auto const output_stream{output_streams[packet->stream_index]};
+        av_packet_rescale_ts(packet, input_stream->time_base, output_stream->time_base);
+        packet->pos = -1;
+
+        result.timestamps.push_back(timestamps_of(packet));
+        if (av_interleaved_write_frame(output_format_context, packet) < 0)
+            throw std::runtime_error("Error muxing packet");
+    }
+    av_write_trailer(output_format_context);
+    result.seconds = std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count();
+    return result;
+}
+
+RunResult run_table(AVFormatContext *input_format_context, std::span<PacketHandle const> const packets,
+                    std::initializer_list<AVMediaType> const relevant_media_types) {
+    auto const output{create_null_output()};
+    auto const output_format_context{output.get()};
+    auto stream_mapping{copy_streams(input_format_context, output_format_context, relevant_media_types)};
+    RunResult result{};
+    result.output_time_bases = write_header(output_format_context);
+    result.timestamps.reserve(packets.size());
+    compute_rescale_factors(input_format_context, stream_mapping);
+
+    auto const packet_handle{make_packet()};
+    auto const packet{packet_handle.get()};
+
+    auto const start{std::chrono::steady_clock::now()};
+    for (auto const &source : packets) {
+        if (av_packet_ref(packet, source.get()) < 0)
+            throw std::runtime_error("Could not reference packet");
+
+        auto const input_index{static_cast<std::size_t>(packet->stream_index)};
+        if (input_index >= stream_mapping.size() || !stream_mapping[input_index].output_stream) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        auto const &mapping{stream_mapping[input_index]};
+        packet->stream_index = mapping.output_stream->index;
+        rescale_packet_ts(packet, mapping);
+        packet->pos = -1;
+
+        result.timestamps.push_back(timestamps_of(packet));
+        if (av_interleaved_write_frame(output_format_context, packet) < 0)
+            throw std::runtime_error("Error muxing packet");
+    }
+    av_write_trailer(output_format_context);
+    result.seconds = std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count();
+    return result;
+}
+
+// What remux should produce: relevant streams numbered in input order, each
+// packet rescaled from its own input stream's time base with av_packet_rescale_ts().
+std::vector<PacketTimestamps> reference_timestamps(AVFormatContext const *input_format_context,
+                                                   std::span<PacketHandle const> const packets,
+                                                   std::initializer_list<AVMediaType> const relevant_media_types,
+                                                   std::span<AVRational const> const output_time_bases) {
+    std::span const input_streams{input_format_context->streams, input_format_context->nb_streams};
+    std::vector<int> output_index(input_streams.size(), -1);
+    int next_output_index{};
+    for (std::size_t i{}; i < input_streams.size(); ++i) {
+        if (std::ranges::find(relevant_media_types, input_streams[i]->codecpar->codec_type) !=
+            relevant_media_types.end())
+            output_index[i] = next_output_index++;
+    }
+
+    auto const packet_handle{make_packet()};
+    auto const packet{packet_handle.get()};
+    std::vector<PacketTimestamps> timestamps;
+    for (auto const &source : packets) {
+        auto const input_index{static_cast<std::size_t>(source->stream_index)};
+        if (input_index >= output_index.size() || output_index[input_index] < 0)
+            continue;
+
+        if (av_packet_ref(packet, source.get()) < 0)
+            throw std::runtime_error("Could not reference packet");
+        packet->stream_index = output_index[input_index];
+        av_packet_rescale_ts(packet, input_streams[input_index]->time_base,
+                             output_time_bases[static_cast<std::size_t>(packet->stream_index)]);
+        timestamps.push_back(timestamps_of(packet));
+        av_packet_unref(packet);
+    }
+    return timestamps;
+}
+
+std::size_t count_mismatches(std::vector<PacketTimestamps> const &expected,
+                             std::vector<PacketTimestamps> const &actual, bool const report) {
+    std::size_t mismatches{expected.size() > actual.size() ? expected.size() - actual.size()
+                                                           : actual.size() - expected.size()};
+    for (std::size_t i{}; i < std::min(expected.size(), actual.size()); ++i) {
+        if (expected[i] == actual[i])
+            continue;
+        if (report && mismatches < 10)
+            std::println(std::cerr, "packet {}: stream {} pts {} dts {} duration {}, expected stream {} pts {} dts {} "
+                         "duration {}", i, actual[i].stream_index, actual[i].pts, actual[i].dts, actual[i].duration,
+                         expected[i].stream_index, expected[i].pts, expected[i].dts, expected[i].duration);
+        mismatches += 1;
+    }
+    return mismatches;
+}
+
+int main(int const argc, char **argv) {
+    if (argc < 2) {
+        std::println(std::cerr, "usage: {} fixture [iterations]\n"
+                     "Compares the packets/s of the map-based and the table-based remux stream mapping\n"
+                     "and checks their timestamps against av_packet_rescale_ts(), with all streams kept\n"
+                     "and with video skipped. Put the video stream first, with a time base that differs\n"
+                     "from the other streams, for the skipped case to exercise the stream remapping.\n",
+                     argv[0]);
+        return EXIT_FAILURE;
+    }
+    int const iterations{argc > 2 ? std::max(1, std::atoi(argv[2])) : 5};
+
+    auto const input_format_context{load_input(argv[1])};
+    auto const packets{read_packets(input_format_context.get())};
+
+    RunResult legacy{}, table{};
+    double legacy_best{}, table_best{};
+    for (int i{}; i < iterations; ++i) {
+        // alternate so neither variant always runs with a warmer cache
+        legacy = run_legacy(input_format_context.get(), packets, all_media_types);
+        table = run_table(input_format_context.get(), packets, all_media_types);
+        legacy_best = i ? std::min(legacy_best, legacy.seconds) : legacy.seconds;
+        table_best = i ? std::min(table_best, table.seconds) : table.seconds;
+    }
+
+    auto const packet_count{static_cast<double>(table.timestamps.size())};
+    std::println("{} packets, best of {} iterations", table.timestamps.size(), iterations);
+    std::println("std::map mapping:     {:.0f} packets/s", packet_count / legacy_best);
+    std::println("StreamMapping table:  {:.0f} packets/s ({:+.1f}%)", packet_count / table_best,
+                 (legacy_best / table_best - 1) * 100);
+
+    auto const reference{reference_timestamps(input_format_context.get(), packets, all_media_types,
+                                              table.output_time_bases)};
+    auto const legacy_mismatches{count_mismatches(reference, legacy.timestamps, true)};
+    auto const table_mismatches{count_mismatches(reference, table.timestamps, true)};
+    std::println("all streams, timestamp mismatches: std::map {}, table {}", legacy_mismatches, table_mismatches);
+
+    // the std::map loop is expected to fail here: it rescales with the time
+    // base of the input stream at the output index
+    auto const skipped_legacy{run_legacy(input_format_context.get(), packets, skip_video_media_types)};
+    auto const skipped_table{run_table(input_format_context.get(), packets, skip_video_media_types)};
+    auto const skipped_reference{reference_timestamps(input_format_context.get(), packets, skip_video_media_types,
+                                                      skipped_table.output_time_bases)};
+    auto const skipped_legacy_mismatches{count_mismatches(skipped_reference, skipped_legacy.timestamps, false)};
+    auto const skipped_table_mismatches{count_mismatches(skipped_reference, skipped_table.timestamps, true)};
+    std::println("video skipped, timestamp mismatches: std::map {} (known bug), table {}",
+                 skipped_legacy_mismatches, skipped_table_mismatches);
+
+    return legacy_mismatches || table_mismatches || skipped_table_mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#pragma warning(pop)
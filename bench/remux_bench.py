@@ -0,0 +1,71 @@
+"""Build a high-packet-rate fixture and run remux_bench on it.
+
+The fixture holds a small video stream followed by two PCM audio streams cut
+into 1 ms packets, about 2000 audio packets per second of media, so the
+per-packet cost of the stream mapping dominates. NUT keeps every packet and
+gives each stream its own time base (1/25 for video, 1/48000 for audio), so
+when remux_bench skips the video stream the audio streams move to a lower
+output index whose input stream has a different time base. remux_bench reports
+packets/s for the std::map and StreamMapping loops and fails if the table's
+timestamps differ from av_packet_rescale_ts() on the right input stream.
+Configure with -DBUILD_BENCHMARKS=ON.
+
+usage: python bench/remux_bench.py <build dir> [seconds] [iterations]
+"""
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def find_executable(build_dir, name):
+    for root, _, files in os.walk(build_dir):
+        for candidate in (name, name + ".exe"):
+            if candidate in files:
+                return os.path.join(root, candidate)
+    sys.exit(f"{name} not found under {build_dir}, was it built with BUILD_BENCHMARKS=ON?")
+
+
+def find_ffmpeg():
+    vendored = os.path.join(REPO, "vendor", "ffmpeg", "bin", "ffmpeg.exe")
+    if os.name == "nt" and os.path.exists(vendored):
+        return vendored
+    ffmpeg = shutil.which("ffmpeg")
+    if not ffmpeg:
+        sys.exit("ffmpeg is needed to build the fixture")
+    return ffmpeg
+
+
+def make_fixture(path, seconds):
+    audio = "sine=frequency={}:sample_rate=48000:samples_per_frame=48:duration={}"
+    subprocess.run([
+        find_ffmpeg(), "-hide_banner", "-loglevel", "error", "-y",
+        "-f", "lavfi", "-i", f"testsrc=size=160x120:rate=25:duration={seconds}",
+        "-f", "lavfi", "-i", audio.format(440, seconds),
+        "-f", "lavfi", "-i", audio.format(880, seconds),
+        "-map", "0", "-map", "1", "-map", "2",
+        "-c:v", "mpeg4", "-c:a", "pcm_s16le",
+        path,
+    ], check=True)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    build_dir = sys.argv[1]
+    seconds = sys.argv[2] if len(sys.argv) > 2 else "60"
+    iterations = sys.argv[3] if len(sys.argv) > 3 else "5"
+
+    remux_bench = find_executable(build_dir, "remux_bench")
+    with tempfile.TemporaryDirectory() as work_dir:
+        fixture = os.path.join(work_dir, "fixture.nut")
+        make_fixture(fixture, seconds)
+        sys.exit(subprocess.run([remux_bench, fixture, iterations]).returncode)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,61 @@
+"""Measure the cost of span tracing in transcode.
+
+Times three variants of the same encode: tracing compiled out
+(transcode_notrace), compiled in but disabled (transcode), and enabled
+(transcode -trace). Configure with -DBUILD_BENCHMARKS=ON -DTRANSCODE_TRACING=ON.
+
+usage: python bench/trace_overhead.py <build dir> [runs]
+"""
+
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def find_executable(build_dir, name):
+    for root, _, files in os.walk(build_dir):
+        for candidate in (name, name + ".exe"):
+            if candidate in files:
+                return os.path.join(root, candidate)
+    sys.exit(f"{name} not found under {build_dir}, was it built with BUILD_BENCHMARKS=ON?")
+
+
+def time_run(command, runs):
+    timings = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run(command, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        timings.append(time.perf_counter() - start)
+    return statistics.median(timings)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    build_dir = sys.argv[1]
+    runs = int(sys.argv[2]) if len(sys.argv) > 2 else 5
+
+    transcode = find_executable(build_dir, "transcode")
+    transcode_notrace = find_executable(build_dir, "transcode_notrace")
+
+    with tempfile.TemporaryDirectory() as work_dir:
+        output = os.path.join(work_dir, "out.mp4")
+        trace = os.path.join(work_dir, "trace.json")
+
+        compiled_out = time_run([transcode_notrace, output], runs)
+        disabled = time_run([transcode, output], runs)
+        enabled = time_run([transcode, output, "-trace", trace], runs)
+        if not os.path.exists(trace):
+            sys.exit("no trace was written, was transcode built with TRANSCODE_TRACING=ON?")
+
+    print(f"median of {runs} runs")
+    print(f"compiled out:          {compiled_out:.3f} s")
+    print(f"compiled in, disabled: {disabled:.3f} s ({(disabled / compiled_out - 1) * 100:+.2f}%)")
+    print(f"enabled:               {enabled:.3f} s ({(enabled / compiled_out - 1) * 100:+.2f}%)")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,8 +1,22 @@
 #pragma warning(push, 0)
-#include <map>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <vector>
 
 extern "C" {
+#include <libavutil/avassert.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/mathematics.h>
 #include <libavutil/mem.h>
+#include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 }
 #pragma warning(pop)
@@ -12,6 +26,12 @@ extern "C" {
 #include <span>
 #include <print>
 
+// the shared headers' inline helpers that remux does not use are dropped on purpose
+#pragma warning(disable : 4514)
+
+#include "av_handles.h"
+#include "stream_mapping.h"
+
 #pragma warning(push)
 #pragma warning(disable : 4365)
 #pragma warning(disable : 4388)
@@ -32,77 +52,45 @@ Args parse_args(int const argc, char **argv) {
     return {argv[1], argv[2]};
 }
 
-AVFormatContext* load_input_video(const char *input_filename) {
-    AVFormatContext *input_format_context{};
-    if (avformat_open_input(&input_format_context, input_filename, nullptr, nullptr) < 0)
+InputFormatContextHandle load_input_video(const char *input_filename) {
+    AVFormatContext *context{};
+    if (avformat_open_input(&context, input_filename, nullptr, nullptr) < 0)
         throw std::runtime_error("Could not open input file");
+    InputFormatContextHandle input_format_context{context};
 
-    if (avformat_find_stream_info(input_format_context, nullptr) < 0)
+    if (avformat_find_stream_info(input_format_context.get(), nullptr) < 0)
         throw std::runtime_error("Failed to retrieve input stream information");
 
     return input_format_context;
 }
 
-AVFormatContext* create_output_video(const char *output_filename) {
+OutputFormatContextHandle create_output_video(const char *output_filename) {
     AVFormatContext *output_format_context{};
     avformat_alloc_output_context2(&output_format_context, nullptr, nullptr, output_filename);
     if (!output_format_context)
         throw std::runtime_error("Could not create output context");
 
-    return output_format_context;
-}
-
-std::map<int, int> copy_streams(AVFormatContext const *input_format_context,
-                                AVFormatContext *output_format_context,
-                                std::initializer_list<AVMediaType> relevant_media_types) {
-    std::map<int, int> stream_mapping;
-    int i{};
-
-    for (std::span const input_streams{input_format_context->streams, input_format_context->nb_streams}; auto const &
-         in_stream : input_streams) {
-        auto const input_codec_parameters{in_stream->codecpar};
-
-        if (std::ranges::find(relevant_media_types, input_codec_parameters->codec_type) == relevant_media_types.end()) {
-            i += 1;
-            continue;
-        }
-
-        stream_mapping[in_stream->index] = in_stream->index - i;
-
-        auto const output_stream{avformat_new_stream(output_format_context, nullptr)};
-        if (!output_stream)
-            throw std::runtime_error("Failed allocating output stream");
-
-        if (avcodec_parameters_copy(output_stream->codecpar, input_codec_parameters) < 0)
-            throw std::runtime_error("Failed to copy codec parameters");
-
-        output_stream->codecpar->codec_tag = 0;
-    }
-
-    return stream_mapping;
+    return OutputFormatContextHandle{output_format_context};
 }
 
 void remux_packets(AVFormatContext *input_format_context, AVFormatContext *output_format_context,
-                   const std::map<int, int> &stream_mapping) {
-    auto const packet{av_packet_alloc()};
-    if (!packet)
+                   std::span<StreamMapping const> const stream_mapping) {
+    auto const packet_handle{make_packet()};
+    if (!packet_handle)
         throw std::runtime_error("Could not allocate AVPacket");
-
-    std::span const input_streams{input_format_context->streams, input_format_context->nb_streams};
-    std::span const output_streams{output_format_context->streams, output_format_context->nb_streams};
+    auto const packet{packet_handle.get()};
 
     while (av_read_frame(input_format_context, packet) >= 0) {
-        if (packet->stream_index >= stream_mapping.size() ||
-            !stream_mapping.contains(packet->stream_index)) {
+        // streams found after the header was read are not mapped either
+        auto const input_index{static_cast<std::size_t>(packet->stream_index)};
+        if (input_index >= stream_mapping.size() || !stream_mapping[input_index].output_stream) {
             av_packet_unref(packet);
             continue;
         }
 
-        packet->stream_index = stream_mapping.at(packet->stream_index);
-
-        auto const input_stream{input_streams[packet->stream_index]};
-        auto const output_stream{output_streams[packet->stream_index]};
-        av_packet_rescale_ts(packet, input_stream->time_base, output_stream->time_base);
+        auto const &mapping{stream_mapping[input_index]};
+        packet->stream_index = mapping.output_stream->index;
+        rescale_packet_ts(packet, mapping);
         packet->pos = -1;
 
         if (av_interleaved_write_frame(output_format_context, packet) < 0)
@@ -130,14 +118,15 @@ void remux_video(const char *input_filename, const char *output_filename,
     auto const input_format_context{load_input_video(input_filename)};
     auto const output_format_context{create_output_video(output_filename)};
 
-    auto const stream_mapping{
-        copy_streams(input_format_context, output_format_context,
+    auto stream_mapping{
+        copy_streams(input_format_context.get(), output_format_context.get(),
                      relevant_media_types)
     };
 
-    open_output_file(output_format_context, output_filename);
-    remux_packets(input_format_context, output_format_context, stream_mapping);
-    close_output_file(output_format_context);
+    open_output_file(output_format_context.get(), output_filename);
+    compute_rescale_factors(input_format_context.get(), stream_mapping);
+    remux_packets(input_format_context.get(), output_format_context.get(), stream_mapping);
+    close_output_file(output_format_context.get());
 }
 
 int main(int const argc, char **argv) {
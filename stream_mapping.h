@@ -0,0 +1,93 @@
+#pragma once
+
+// Dense input-to-output stream table used by remux, shared with
+// bench/remux_bench.cpp.
+
+extern "C" {
+#include <libavutil/mathematics.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 5045) // Spectre mitigation notice on indexed loads
+#endif
+
+// Where the packets of one input stream go, indexed by input stream index.
+// Timestamps are rescaled with av_rescale_rnd(ts, rescale_num, rescale_den,
+// AV_ROUND_NEAR_INF), which is exactly what av_packet_rescale_ts() computes
+// through av_rescale_q() from the two time bases.
+struct StreamMapping {
+    AVStream *output_stream; // nullptr if the input stream is skipped
+    int64_t rescale_num;
+    int64_t rescale_den;
+};
+
+inline std::vector<StreamMapping> copy_streams(AVFormatContext const *input_format_context,
+                                               AVFormatContext *output_format_context,
+                                               std::initializer_list<AVMediaType> relevant_media_types) {
+    std::vector<StreamMapping> stream_mapping(input_format_context->nb_streams);
+
+    for (std::span const input_streams{input_format_context->streams, input_format_context->nb_streams}; auto const &
+         in_stream : input_streams) {
+        auto const input_codec_parameters{in_stream->codecpar};
+
+        if (std::ranges::find(relevant_media_types, input_codec_parameters->codec_type) == relevant_media_types.end())
+            continue;
+
+        auto const output_stream{avformat_new_stream(output_format_context, nullptr)};
+        if (!output_stream)
+            throw std::runtime_error("Failed allocating output stream");
+
+        if (avcodec_parameters_copy(output_stream->codecpar, input_codec_parameters) < 0)
+            throw std::runtime_error("Failed to copy codec parameters");
+
+        output_stream->codecpar->codec_tag = 0;
+        stream_mapping[static_cast<std::size_t>(in_stream->index)].output_stream = output_stream;
+    }
+
+    return stream_mapping;
+}
+
+// The muxer may adjust output time bases in avformat_write_header(), so the
+// rescale factors can only be computed once the header is written.
+inline void compute_rescale_factors(AVFormatContext const *input_format_context,
+                                    std::span<StreamMapping> stream_mapping) {
+    std::span const input_streams{input_format_context->streams, input_format_context->nb_streams};
+    for (std::size_t i{}; i < stream_mapping.size(); ++i) {
+        auto &mapping{stream_mapping[i]};
+        if (!mapping.output_stream)
+            continue;
+
+        auto const input_time_base{input_streams[i]->time_base};
+        auto const output_time_base{mapping.output_stream->time_base};
+        mapping.rescale_num = int64_t{input_time_base.num} * output_time_base.den;
+        mapping.rescale_den = int64_t{output_time_base.num} * input_time_base.den;
+    }
+}
+
+inline void rescale_packet_ts(AVPacket *packet, StreamMapping const &mapping) {
+    if (mapping.rescale_num == mapping.rescale_den)
+        return;
+
+    if (packet->pts != AV_NOPTS_VALUE)
+        packet->pts = av_rescale_rnd(packet->pts, mapping.rescale_num, mapping.rescale_den, AV_ROUND_NEAR_INF);
+    if (packet->dts != AV_NOPTS_VALUE)
+        packet->dts = av_rescale_rnd(packet->dts, mapping.rescale_num, mapping.rescale_den, AV_ROUND_NEAR_INF);
+    if (packet->duration > 0)
+        packet->duration = av_rescale_rnd(packet->duration, mapping.rescale_num, mapping.rescale_den,
+                                          AV_ROUND_NEAR_INF);
+}
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
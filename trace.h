@@ -0,0 +1,100 @@
+#pragma once
+
+// Span tracing for the transcode loop, exported as Chrome trace-event JSON
+// (load the file in chrome://tracing or https://ui.perfetto.dev).
+//
+// Every thread appends completed spans to its own buffer, so recording never
+// takes a lock; the buffers are only walked by trace_dump() once the worker
+// threads are done. When built without TRANSCODE_TRACING, TRACE_SPAN expands to
+// nothing; when built with it but not enabled at runtime, a span costs a single
+// relaxed load.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    char const *name;
+    int64_t begin_ns;
+    int64_t end_ns;
+};
+
+struct TraceBuffer {
+    uint32_t tid;
+    std::vector<TraceEvent> events;
+};
+
+inline std::atomic<bool> trace_enabled{false};
+inline std::chrono::steady_clock::time_point const trace_epoch{std::chrono::steady_clock::now()};
+
+/* registry of per-thread buffers, only locked once per thread and at dump time */
+inline std::mutex trace_registry_mutex;
+inline std::vector<std::unique_ptr<TraceBuffer>> trace_registry;
+
+inline int64_t trace_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+inline TraceBuffer &trace_thread_buffer() {
+    thread_local TraceBuffer *buffer{[] {
+        std::scoped_lock const lock{trace_registry_mutex};
+        auto &registered{trace_registry.emplace_back(std::make_unique<TraceBuffer>())};
+        registered->tid = static_cast<uint32_t>(trace_registry.size());
+        registered->events.reserve(1 << 16);
+        return registered.get();
+    }()};
+    return *buffer;
+}
+
+class TraceSpan {
+public:
+    explicit TraceSpan(char const *name)
+        : name_{name}, begin_ns_{trace_enabled.load(std::memory_order_relaxed) ? trace_now_ns() : -1} {}
+
+    ~TraceSpan() {
+        if (begin_ns_ >= 0)
+            trace_thread_buffer().events.push_back({name_, begin_ns_, trace_now_ns()});
+    }
+
+    TraceSpan(TraceSpan const &) = delete;
+    TraceSpan &operator=(TraceSpan const &) = delete;
+
+private:
+    char const *name_;
+    int64_t begin_ns_;
+};
+
+/* Write every recorded span as a complete ("X") event. Returns false if the
+ * file could not be written. Must not race with threads still recording. */
+inline bool trace_dump(char const *filename) {
+    FILE *f = fopen(filename, "w");
+    if (!f)
+        return false;
+
+    std::scoped_lock const lock{trace_registry_mutex};
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", f);
+    char const *separator = "\n";
+    for (auto const &buffer : trace_registry) {
+        for (auto const &[name, begin_ns, end_ns] : buffer->events) {
+            fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"transcode\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                    "\"ts\":%.3f,\"dur\":%.3f}",
+                    separator, name, buffer->tid, begin_ns / 1000.0, (end_ns - begin_ns) / 1000.0);
+            separator = ",\n";
+        }
+    }
+    fputs("\n]}\n", f);
+    return fclose(f) == 0;
+}
+
+#ifdef TRANSCODE_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan const TRACE_CONCAT(trace_span_, __LINE__){name}
+#else
+#define TRACE_SPAN(name) ((void)0)
+#endif
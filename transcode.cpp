@@ -1,7 +1,15 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <deque>
+#include <new>
+#include <optional>
+#include <thread>
+#include <vector>
 
 extern "C" {
 #include <libavutil/avassert.h>
@@ -15,32 +23,85 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
+#include "av_handles.h"
+#include "trace.h"
+
+/* Allocation-counting hook for this executable's own heap use (containers,
+ * trace buffers, ...), reported with -stats. The libav* DLLs allocate through
+ * their own C runtime and never reach it. */
+static std::atomic<uint64_t> heap_allocation_count{0};
+
+void *operator new(std::size_t const size) {
+    heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, std::size_t) noexcept { free(p); }
+
 #define STREAM_DURATION   10.0
 #define STREAM_FRAME_RATE 25 /* 25 images/s */
 #define STREAM_PIX_FMT    AV_PIX_FMT_YUV420P /* default pix_fmt */
 
 #define SCALE_FLAGS SWS_BICUBIC
 
+// creation-to-write latency of encoded video frames, tracked in low latency mode;
+// audio is not tracked, as encoder priming shifts audio packet pts away from
+// the pts of the frames they complete
+struct LatencyStats {
+    struct Pending {
+        int64_t pts;
+        int64_t created_ns;
+    };
+
+    /* frames still inside the encoder, in pts order */
+    std::deque<Pending> pending;
+    std::vector<int64_t> samples_ns;
+};
+
+struct SwsContextDeleter {
+    void operator()(SwsContext *context) const { sws_freeContext(context); }
+};
+
+struct SwrContextDeleter {
+    void operator()(SwrContext *context) const { swr_free(&context); }
+};
+
 // a wrapper around a single output AVStream
 typedef struct OutputStream {
     AVStream *st;
-    AVCodecContext *enc;
+    CodecContextHandle enc;
 
     /* pts of the next frame that will be generated */
     int64_t next_pts;
     int samples_count;
 
-    AVFrame *frame;
-    AVFrame *tmp_frame;
+    FrameHandle frame;
+    FrameHandle tmp_frame;
+    /* recycles the buffers of frame while the encoder still references them */
+    std::optional<FramePool> frame_pool;
 
-    AVPacket *tmp_pkt;
+    PacketHandle tmp_pkt;
+    PacketArena packet_arena;
 
     float t, tincr, tincr2;
 
-    SwsContext *sws_ctx;
-    SwrContext *swr_ctx;
+    std::unique_ptr<SwsContext, SwsContextDeleter> sws_ctx;
+    std::unique_ptr<SwrContext, SwrContextDeleter> swr_ctx;
+
+    /* write packets straight through with av_write_frame() */
+    bool low_latency;
+    /* nullptr unless per-frame latency is measured */
+    LatencyStats *latency;
 } OutputStream;
 
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 #undef av_err2str
 #define av_err2str(errnum) \
 ([](int errnum) { \
@@ -49,9 +110,14 @@ return av_make_error_string(errbuf, AV_ERROR_MAX_STRING_SIZE, errnum); \
 }(errnum))
 
 static int write_frame(AVFormatContext *fmt_ctx, AVCodecContext *c,
-                       AVStream const *st, AVFrame const *frame, AVPacket *pkt) {
+                       AVStream const *st, AVFrame const *frame, AVPacket *pkt,
+                       bool const low_latency, LatencyStats *latency) {
     // send the frame to the encoder
-    int ret = avcodec_send_frame(c, frame);
+    int ret;
+    {
+        TRACE_SPAN("avcodec_send_frame");
+        ret = avcodec_send_frame(c, frame);
+    }
     if (ret < 0) {
         fprintf(stderr, "Error sending a frame to the encoder: %s\n",
                 av_err2str(ret));
@@ -59,7 +125,10 @@ static int write_frame(AVFormatContext *fmt_ctx, AVCodecContext *c,
     }
 
     while (true) {
-        ret = avcodec_receive_packet(c, pkt);
+        {
+            TRACE_SPAN("avcodec_receive_packet");
+            ret = avcodec_receive_packet(c, pkt);
+        }
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
             break;
         if (ret < 0) {
@@ -67,19 +136,44 @@ static int write_frame(AVFormatContext *fmt_ctx, AVCodecContext *c,
             exit(1);
         }
 
+        int64_t const pts = pkt->pts;
+
         /* rescale output packet timestamp values from codec to stream timebase */
         av_packet_rescale_ts(pkt, c->time_base, st->time_base);
         pkt->stream_index = st->index;
 
         /* Write the compressed frame to the media file. */
-        ret = av_interleaved_write_frame(fmt_ctx, pkt);
-        /* pkt is now blank (av_interleaved_write_frame() takes ownership of
-         * its contents and resets pkt), so that no unreferencing is necessary.
-         * This would be different if one used av_write_frame(). */
+        if (low_latency) {
+            /* The interleaving queue would hold this packet back until the
+             * other stream catches up. Frames are already generated in pts
+             * order, so write it directly; with AVFMT_FLAG_FLUSH_PACKETS set,
+             * av_write_frame() also flushes it out to the protocol. Unlike
+             * av_interleaved_write_frame() it leaves pkt referenced. */
+            TRACE_SPAN("av_write_frame");
+            ret = av_write_frame(fmt_ctx, pkt);
+            av_packet_unref(pkt);
+        }
+        else {
+            TRACE_SPAN("av_interleaved_write_frame");
+            ret = av_interleaved_write_frame(fmt_ctx, pkt);
+            /* pkt is now blank (av_interleaved_write_frame() takes ownership of
+             * its contents and resets pkt), so that no unreferencing is necessary. */
+        }
         if (ret < 0) {
             fprintf(stderr, "Error while writing output packet: %s\n", av_err2str(ret));
             exit(1);
         }
+
+        if (latency) {
+            /* the packet has been flushed at this point; without reordering it
+             * completes exactly the frame with its pts, and anything older the
+             * encoder dropped is retired along with it */
+            int64_t const written_ns = now_ns();
+            while (!latency->pending.empty() && latency->pending.front().pts <= pts) {
+                latency->samples_ns.push_back(written_ns - latency->pending.front().created_ns);
+                latency->pending.pop_front();
+            }
+        }
     }
 
     return ret == AVERROR_EOF ? 1 : 0;
@@ -88,7 +182,7 @@ static int write_frame(AVFormatContext *fmt_ctx, AVCodecContext *c,
 /* Add an output stream. */
 static void add_stream(OutputStream *ost, AVFormatContext *oc,
                        const AVCodec **codec,
-                       AVCodecID const codec_id) {
+                       AVCodecID const codec_id, bool const low_latency) {
     /* find the encoder */
     *codec = avcodec_find_encoder(codec_id);
     if (!*codec) {
@@ -97,7 +191,7 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
         exit(1);
     }
 
-    ost->tmp_pkt = av_packet_alloc();
+    ost->tmp_pkt = make_packet();
     if (!ost->tmp_pkt) {
         fprintf(stderr, "Could not allocate AVPacket\n");
         exit(1);
@@ -114,7 +208,9 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
         fprintf(stderr, "Could not alloc an encoding context\n");
         exit(1);
     }
-    ost->enc = c;
+    ost->enc.reset(c);
+    ost->low_latency = low_latency;
+    ost->packet_arena.attach(c, *codec);
 
     // av_channel_layout_copy(&c->ch_layout, &(AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO);
     constexpr uint64_t stereo_channels = 1ULL << AV_CHAN_FRONT_LEFT | 1ULL << AV_CHAN_FRONT_RIGHT;
@@ -156,10 +252,25 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
 
             c->gop_size = 12; /* emit one intra frame every twelve frames at most */
             c->pix_fmt = STREAM_PIX_FMT;
-            if (c->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
+            if (c->codec_id == AV_CODEC_ID_MPEG2VIDEO && !low_latency) {
                 /* just for testing, we also add B-frames */
                 c->max_b_frames = 2;
             }
+            if (low_latency) {
+                /* no reordering and no lookahead: every frame leaves the encoder
+                 * as soon as it is encoded; split frames across threads in slices
+                 * rather than pipelining whole frames */
+                c->max_b_frames = 0;
+                if (c->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
+                    /* the other mpegvideo encoders refuse to open with it */
+                    c->flags |= AV_CODEC_FLAG_LOW_DELAY;
+                }
+                c->thread_type = FF_THREAD_SLICE;
+                c->thread_count = 0; /* auto, libavcodec defaults to a single thread */
+                /* only understood by some encoders (libx264, libx265...), ignore failures */
+                av_opt_set(c->priv_data, "tune", "zerolatency", 0);
+                av_opt_set_int(c->priv_data, "rc-lookahead", 0, 0);
+            }
             if (c->codec_id == AV_CODEC_ID_MPEG1VIDEO) {
                 /* Needed to avoid using macroblocks in which some coeffs overflow.
                  * This does not happen with normal video, it just happens here as
@@ -180,10 +291,10 @@ static void add_stream(OutputStream *ost, AVFormatContext *oc,
 /**************************************************************/
 /* audio output */
 
-static AVFrame* alloc_audio_frame(AVSampleFormat const sample_fmt,
-                                  const AVChannelLayout *channel_layout,
-                                  int const sample_rate, int const nb_samples) {
-    AVFrame *frame = av_frame_alloc();
+static FrameHandle alloc_audio_frame(AVSampleFormat const sample_fmt,
+                                     const AVChannelLayout *channel_layout,
+                                     int const sample_rate, int const nb_samples) {
+    FrameHandle frame = make_frame();
     if (!frame) {
         fprintf(stderr, "Error allocating an audio frame\n");
         exit(1);
@@ -195,7 +306,7 @@ static AVFrame* alloc_audio_frame(AVSampleFormat const sample_fmt,
     frame->nb_samples = nb_samples;
 
     if (nb_samples) {
-        if (av_frame_get_buffer(frame, 0) < 0) {
+        if (av_frame_get_buffer(frame.get(), 0) < 0) {
             fprintf(stderr, "Error allocating an audio buffer\n");
             exit(1);
         }
@@ -209,7 +320,7 @@ static void open_audio(const AVCodec *codec,
     int nb_samples;
     AVDictionary *opt = nullptr;
 
-    AVCodecContext *c = ost->enc;
+    AVCodecContext *c = ost->enc.get();
 
     /* open it */
     av_dict_copy(&opt, opt_arg, 0);
@@ -235,6 +346,7 @@ static void open_audio(const AVCodec *codec,
                                    c->sample_rate, nb_samples);
     ost->tmp_frame = alloc_audio_frame(AV_SAMPLE_FMT_S16, &c->ch_layout,
                                        c->sample_rate, nb_samples);
+    ost->frame_pool.emplace(ost->frame.get());
 
     /* copy the stream parameters to the muxer */
     ret = avcodec_parameters_from_context(ost->st->codecpar, c);
@@ -244,28 +356,30 @@ static void open_audio(const AVCodec *codec,
     }
 
     /* create resampler context */
-    ost->swr_ctx = swr_alloc();
-    if (!ost->swr_ctx) {
+    ost->swr_ctx.reset(swr_alloc());
+    SwrContext *swr_ctx = ost->swr_ctx.get();
+    if (!swr_ctx) {
         fprintf(stderr, "Could not allocate resampler context\n");
         exit(1);
     }
 
     /* set options */
-    av_opt_set_chlayout(ost->swr_ctx, "in_chlayout", &c->ch_layout, 0);
-    av_opt_set_int(ost->swr_ctx, "in_sample_rate", c->sample_rate, 0);
-    av_opt_set_sample_fmt(ost->swr_ctx, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
-    av_opt_set_chlayout(ost->swr_ctx, "out_chlayout", &c->ch_layout, 0);
-    av_opt_set_int(ost->swr_ctx, "out_sample_rate", c->sample_rate, 0);
-    av_opt_set_sample_fmt(ost->swr_ctx, "out_sample_fmt", c->sample_fmt, 0);
+    av_opt_set_chlayout(swr_ctx, "in_chlayout", &c->ch_layout, 0);
+    av_opt_set_int(swr_ctx, "in_sample_rate", c->sample_rate, 0);
+    av_opt_set_sample_fmt(swr_ctx, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
+    av_opt_set_chlayout(swr_ctx, "out_chlayout", &c->ch_layout, 0);
+    av_opt_set_int(swr_ctx, "out_sample_rate", c->sample_rate, 0);
+    av_opt_set_sample_fmt(swr_ctx, "out_sample_fmt", c->sample_fmt, 0);
 
     /* initialize the resampling context */
-    swr_init(ost->swr_ctx);
+    swr_init(swr_ctx);
 }
 
 /* Prepare a 16-bit dummy audio frame of 'frame_size' samples and
  * 'nb_channels' channels. */
 static AVFrame* get_audio_frame(OutputStream *ost) {
-    AVFrame *frame = ost->tmp_frame;
+    TRACE_SPAN("get_audio_frame");
+    AVFrame *frame = ost->tmp_frame.get();
     auto *q = reinterpret_cast<int16_t*>(frame->data[0]);
 
     /* check if we want to generate more frames */
@@ -292,46 +406,49 @@ static AVFrame* get_audio_frame(OutputStream *ost) {
  * return 1 when encoding is finished, 0 otherwise
  */
 static int write_audio_frame(AVFormatContext *oc, OutputStream *ost) {
-    AVCodecContext *c = ost->enc;
+    AVCodecContext *c = ost->enc.get();
 
     AVFrame *frame = get_audio_frame(ost);
 
     if (frame) {
         /* convert samples from native format to destination codec format, using the resampler */
         /* compute destination number of samples */
-        int const dst_nb_samples = swr_get_delay(ost->swr_ctx, c->sample_rate) + frame->nb_samples;
+        int const dst_nb_samples = swr_get_delay(ost->swr_ctx.get(), c->sample_rate) + frame->nb_samples;
         av_assert0(dst_nb_samples == frame->nb_samples);
 
         /* when we pass a frame to the encoder, it may keep a reference to it
          * internally;
          * make sure we do not overwrite it here
          */
-        int ret = av_frame_make_writable(ost->frame);
+        int ret = ost->frame_pool->make_writable(ost->frame.get());
         if (ret < 0)
             exit(1);
 
         /* convert to destination format */
-        ret = swr_convert(ost->swr_ctx,
-                          ost->frame->data, dst_nb_samples,
-                          frame->data, frame->nb_samples);
+        {
+            TRACE_SPAN("swr_convert");
+            ret = swr_convert(ost->swr_ctx.get(),
+                              ost->frame->data, dst_nb_samples,
+                              frame->data, frame->nb_samples);
+        }
         if (ret < 0) {
             fprintf(stderr, "Error while converting\n");
             exit(1);
         }
-        frame = ost->frame;
+        frame = ost->frame.get();
 
         frame->pts = av_rescale_q(ost->samples_count, AVRational{1, c->sample_rate}, c->time_base);
         ost->samples_count += dst_nb_samples;
     }
 
-    return write_frame(oc, c, ost->st, frame, ost->tmp_pkt);
+    return write_frame(oc, c, ost->st, frame, ost->tmp_pkt.get(), ost->low_latency, ost->latency);
 }
 
 /**************************************************************/
 /* video output */
 
-static AVFrame* alloc_frame(AVPixelFormat const pix_fmt, int const width, int const height) {
-    AVFrame *frame = av_frame_alloc();
+static FrameHandle alloc_frame(AVPixelFormat const pix_fmt, int const width, int const height) {
+    FrameHandle frame = make_frame();
     if (!frame)
         return nullptr;
 
@@ -340,7 +457,7 @@ static AVFrame* alloc_frame(AVPixelFormat const pix_fmt, int const width, int co
     frame->height = height;
 
     /* allocate the buffers for the frame data */
-    if (int const ret = av_frame_get_buffer(frame, 0); ret < 0) {
+    if (int const ret = av_frame_get_buffer(frame.get(), 0); ret < 0) {
         fprintf(stderr, "Could not allocate frame data.\n");
         exit(1);
     }
@@ -350,7 +467,7 @@ static AVFrame* alloc_frame(AVPixelFormat const pix_fmt, int const width, int co
 
 static void open_video(const AVCodec *codec,
                        OutputStream *ost, AVDictionary const *opt_arg) {
-    AVCodecContext *c = ost->enc;
+    AVCodecContext *c = ost->enc.get();
     AVDictionary *opt = nullptr;
 
     av_dict_copy(&opt, opt_arg, 0);
@@ -369,11 +486,12 @@ static void open_video(const AVCodec *codec,
         fprintf(stderr, "Could not allocate video frame\n");
         exit(1);
     }
+    ost->frame_pool.emplace(ost->frame.get());
 
     /* If the output format is not YUV420P, then a temporary YUV420P
      * picture is needed too. It is then converted to the required
      * output format. */
-    ost->tmp_frame = nullptr;
+    ost->tmp_frame.reset();
     if (c->pix_fmt != AV_PIX_FMT_YUV420P) {
         ost->tmp_frame = alloc_frame(AV_PIX_FMT_YUV420P, c->width, c->height);
         if (!ost->tmp_frame) {
@@ -412,7 +530,8 @@ static void fill_yuv_image(AVFrame const *pict, int const frame_index,
 }
 
 static AVFrame* get_video_frame(OutputStream *ost) {
-    AVCodecContext const *c = ost->enc;
+    TRACE_SPAN("get_video_frame");
+    AVCodecContext const *c = ost->enc.get();
 
     /* check if we want to generate more frames */
     if (av_compare_ts(ost->next_pts, c->time_base,
@@ -421,34 +540,37 @@ static AVFrame* get_video_frame(OutputStream *ost) {
 
     /* when we pass a frame to the encoder, it may keep a reference to it
      * internally; make sure we do not overwrite it here */
-    if (av_frame_make_writable(ost->frame) < 0)
+    if (ost->frame_pool->make_writable(ost->frame.get()) < 0)
         exit(1);
 
     if (c->pix_fmt != AV_PIX_FMT_YUV420P) {
         /* as we only generate a YUV420P picture, we must convert it
          * to the codec pixel format if needed */
         if (!ost->sws_ctx) {
-            ost->sws_ctx = sws_getContext(c->width, c->height,
-                                          AV_PIX_FMT_YUV420P,
-                                          c->width, c->height,
-                                          c->pix_fmt,
-                                          SCALE_FLAGS, nullptr, nullptr, nullptr);
+            ost->sws_ctx.reset(sws_getContext(c->width, c->height,
+                                              AV_PIX_FMT_YUV420P,
+                                              c->width, c->height,
+                                              c->pix_fmt,
+                                              SCALE_FLAGS, nullptr, nullptr, nullptr));
             if (!ost->sws_ctx) {
                 fprintf(stderr,
                         "Could not initialize the conversion context\n");
                 exit(1);
             }
         }
-        fill_yuv_image(ost->tmp_frame, ost->next_pts, c->width, c->height);
-        sws_scale(ost->sws_ctx, ost->tmp_frame->data,
+        fill_yuv_image(ost->tmp_frame.get(), ost->next_pts, c->width, c->height);
+        TRACE_SPAN("sws_scale");
+        sws_scale(ost->sws_ctx.get(), ost->tmp_frame->data,
                   ost->tmp_frame->linesize, 0, c->height, ost->frame->data,
                   ost->frame->linesize);
     }
-    else { fill_yuv_image(ost->frame, ost->next_pts, c->width, c->height); }
+    else { fill_yuv_image(ost->frame.get(), ost->next_pts, c->width, c->height); }
 
     ost->frame->pts = ost->next_pts++;
+    if (ost->latency)
+        ost->latency->pending.push_back({ost->frame->pts, now_ns()});
 
-    return ost->frame;
+    return ost->frame.get();
 }
 
 /*
@@ -456,17 +578,32 @@ static AVFrame* get_video_frame(OutputStream *ost) {
  * return 1 when encoding is finished, 0 otherwise
  */
 static int write_video_frame(AVFormatContext *oc, OutputStream *ost) {
-    return write_frame(oc, ost->enc, ost->st, get_video_frame(ost), ost->tmp_pkt);
+    return write_frame(oc, ost->enc.get(), ost->st, get_video_frame(ost), ost->tmp_pkt.get(),
+                       ost->low_latency, ost->latency);
+}
+
+static void print_latency(const char *name, LatencyStats *stats) {
+    std::vector<int64_t> &samples = stats->samples_ns;
+    if (samples.empty())
+        return;
+
+    std::ranges::sort(samples);
+    auto const percentile = [&](int const p) {
+        return samples[(samples.size() - 1) * p / 100] / 1e6;
+    };
+    fprintf(stderr, "%s encode latency over %zu frames: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            name, samples.size(), percentile(50), percentile(99), samples.back() / 1e6);
 }
 
-static void close_stream(OutputStream *ost) {
-    avcodec_free_context(&ost->enc);
-    av_frame_free(&ost->frame);
-    av_frame_free(&ost->tmp_frame);
-    av_packet_free(&ost->tmp_pkt);
-    sws_freeContext(ost->sws_ctx);
-    swr_free(&ost->swr_ctx);
+#ifdef TRANSCODE_TRACING
+/* where the atexit handler writes the trace, so error paths that exit() keep it */
+static const char *trace_output;
+
+static void dump_trace_at_exit() {
+    if (!trace_dump(trace_output))
+        fprintf(stderr, "Could not write trace to '%s'\n", trace_output);
 }
+#endif
 
 /**************************************************************/
 /* media file output */
@@ -485,38 +622,79 @@ int main(int const argc, char **argv) {
                "muxes them into a file named output_file.\n"
                "The output format is automatically guessed according to the file extension.\n"
                "Raw images can also be output by using '%%d' in the filename.\n"
+               "Use '-trace trace.json' to record a Chrome trace-event timeline of the encode loop.\n"
+               "Use '-low_latency 1' for a zero-latency live encode paced in real time, e.g. to\n"
+               "'pipe:1' or 'tcp://127.0.0.1:1234?listen' together with '-f mpegts'. It reports\n"
+               "the encode latency of video frames (audio is not measured).\n"
+               "Use '-stats 1' to report the allocations per video frame that remain in steady state.\n"
                "\n", argv[0]);
         return 1;
     }
 
     const char *filename = argv[1];
+    const char *trace_filename = nullptr;
+    const char *format_name = nullptr;
+    bool low_latency = false;
+    bool print_stats = false;
     for (int i = 2; i + 1 < argc; i += 2) {
         if (!strcmp(argv[i], "-flags") || !strcmp(argv[i], "-fflags"))
             av_dict_set(&opt, argv[i] + 1, argv[i + 1], 0);
+        else if (!strcmp(argv[i], "-trace"))
+            trace_filename = argv[i + 1];
+        else if (!strcmp(argv[i], "-f"))
+            format_name = argv[i + 1];
+        else if (!strcmp(argv[i], "-low_latency"))
+            low_latency = atoi(argv[i + 1]) != 0;
+        else if (!strcmp(argv[i], "-stats"))
+            print_stats = atoi(argv[i + 1]) != 0;
+    }
+
+#ifdef TRANSCODE_TRACING
+    if (trace_filename) {
+        trace_output = trace_filename;
+        atexit(dump_trace_at_exit);
+        trace_enabled = true;
     }
+#else
+    if (trace_filename)
+        fprintf(stderr, "Tracing is not compiled in, ignoring -trace\n");
+#endif
 
     /* allocate the output media context */
-    AVFormatContext *oc;
-    avformat_alloc_output_context2(&oc, nullptr, nullptr, filename);
-    if (!oc) {
-        printf("Could not deduce output format from file extension: using MPEG.\n");
+    AVFormatContext *oc = nullptr;
+    avformat_network_init();
+    avformat_alloc_output_context2(&oc, nullptr, format_name, filename);
+    if (!oc && !format_name) {
+        /* stderr, as the output itself may be going to stdout */
+        fprintf(stderr, "Could not deduce output format from file extension: using MPEG.\n");
         avformat_alloc_output_context2(&oc, nullptr, "mpeg", filename);
     }
     if (!oc)
         return 1;
+    OutputFormatContextHandle oc_handle{oc};
 
     const AVOutputFormat *fmt = oc->oformat;
     OutputStream video_st{}, audio_st{};
+    LatencyStats video_latency;
+
+    if (low_latency) {
+        /* hand every packet to the protocol as soon as it is muxed; max_delay
+         * is the mpeg/mpegts mux preload, interleaving is bypassed in write_frame() */
+        oc->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+        oc->max_delay = 0;
+        video_st.latency = &video_latency;
+        video_latency.samples_ns.reserve(static_cast<size_t>(STREAM_DURATION * STREAM_FRAME_RATE) + 1);
+    }
 
     /* Add the audio and video streams using the default format codecs
      * and initialize the codecs. */
     if (fmt->video_codec != AV_CODEC_ID_NONE) {
-        add_stream(&video_st, oc, &video_codec, fmt->video_codec);
+        add_stream(&video_st, oc, &video_codec, fmt->video_codec, low_latency);
         have_video = 1;
         encode_video = 1;
     }
     if (fmt->audio_codec != AV_CODEC_ID_NONE) {
-        add_stream(&audio_st, oc, &audio_codec, fmt->audio_codec);
+        add_stream(&audio_st, oc, &audio_codec, fmt->audio_codec, low_latency);
         have_audio = 1;
         encode_audio = 1;
     }
@@ -549,30 +727,54 @@ int main(int const argc, char **argv) {
         return 1;
     }
 
+    /* counters once the first second of video is out, when every pool has
+     * seen its working set */
+    int64_t warm_pts = -1;
+    uint64_t warm_misses = 0, warm_gets = 0, warm_heap = 0;
+
+    auto const start = std::chrono::steady_clock::now();
     while (encode_video || encode_audio) {
         /* select the stream to encode */
         if (encode_video &&
             (!encode_audio || av_compare_ts(video_st.next_pts, video_st.enc->time_base,
                                             audio_st.next_pts, audio_st.enc->time_base) <= 0)) {
+            if (low_latency) {
+                /* generate frames in real time, as a live source would */
+                std::this_thread::sleep_until(
+                    start + std::chrono::microseconds{video_st.next_pts * 1000000 / STREAM_FRAME_RATE});
+            }
             encode_video = !write_video_frame(oc, &video_st);
+            if (warm_pts < 0 && video_st.next_pts >= STREAM_FRAME_RATE) {
+                warm_pts = video_st.next_pts;
+                warm_misses = pool_miss_count;
+                warm_gets = pool_get_count;
+                warm_heap = heap_allocation_count;
+            }
         }
         else { encode_audio = !write_audio_frame(oc, &audio_st); }
     }
 
-    av_write_trailer(oc);
+    if (print_stats && warm_pts >= 0 && video_st.next_pts > warm_pts) {
+        auto const frames = static_cast<double>(video_st.next_pts - warm_pts);
+        fprintf(stderr, "allocations per video frame after the first second:\n"
+                "  %.3f pool misses (new frame or packet data buffers)\n"
+                "  %.3f pool gets (each mallocs an AVBufferRef inside libavutil)\n"
+                "  %.3f operator new calls in this program\n"
+                "  allocations made inside libavcodec/libavformat are not counted\n",
+                static_cast<double>(pool_miss_count - warm_misses) / frames,
+                static_cast<double>(pool_get_count - warm_gets) / frames,
+                static_cast<double>(heap_allocation_count - warm_heap) / frames);
+    }
 
-    /* Close each codec. */
-    if (have_video)
-        close_stream(&video_st);
-    if (have_audio)
-        close_stream(&audio_st);
+    av_write_trailer(oc);
 
-    if (!(fmt->flags & AVFMT_NOFILE))
-        /* Close the output file. */
-        avio_closep(&oc->pb);
+    if (low_latency)
+        print_latency("video", &video_latency);
 
-    /* free the stream */
-    avformat_free_context(oc);
+    /* close the output file and free the stream before shutting down the
+     * network; codecs and frames are released with their OutputStream */
+    oc_handle.reset();
+    avformat_network_deinit();
 
     return 0;
 }